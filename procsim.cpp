@@ -1,25 +1,58 @@
 #include "procsim.hpp"
+#include "trace_prefetch.hpp"
+#include "scheduler_policy.hpp"
+
+// Instructions decoded ahead of fetch(); must be a power of two
+#define PREFETCH_RING_SIZE (1 << 14)
 
 
 vector<reg>* register_file;
 vector<result_bus>* result_buses;
-vector<proc_inst_t>* instruction_queue;
+TracePrefetcher* trace_prefetcher;
+InstructionCache* icache = NULL;
 vector<proc_inst_t>* dispatch_queue;
 vector<proc_inst_t>* completed_instruction_queue;
 
 SchedulingQueue* schedule_queue;
 Scoreboard* scoreboard;
+SchedulerPolicy* scheduler_policy;
 
 int number_of_instructions_to_fetch;
 int number_of_results_buses;
 
 int cycle_count;
-uint64_t inst_count;
+uint64_t fetched_count;
+uint64_t fetch_stall_cycles;
+uint64_t fetch_stall_remaining;
+bool fetch_line_filled;
+
+proc_inst_t pending_fetch;
+bool has_pending_fetch;
 
 double dispatch_size_per_cycle;
 double instructions_fired_per_cycle;
 double instructions_retired_per_cycle;
 
+uint64_t warmup_instructions;
+double converge_epsilon;
+
+FILE* timing_log = stdout;
+SelfProfiler* self_profiler = NULL;
+
+/**
+ * Runs one stage of the processor, charging its host cost to the self profiler when there is one.
+ */
+static inline void run_stage(profile_stage stage, void (*stage_function)()){
+    if(self_profiler == NULL){
+        stage_function();
+        return;
+    }
+
+    self_profiler->begin();
+    stage_function();
+    self_profiler->end(stage);
+}
+
 /**
  * Subroutine for initializing the processor. You many add and initialize any global or heap
  * variables as needed.
@@ -33,23 +66,69 @@ double instructions_retired_per_cycle;
  */
 void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
 {
-    register_file = new vector<reg> (128);
+    register_file = new vector<reg> (NUM_REGISTERS);
     result_buses = new vector<result_bus> (r);
 
-    instruction_queue = new vector<proc_inst_t>;
+    trace_prefetcher = new TracePrefetcher(PREFETCH_RING_SIZE);
     dispatch_queue = new vector<proc_inst_t>;
     completed_instruction_queue = new vector<proc_inst_t>;
 
     schedule_queue = new SchedulingQueue(k0, k1, k2);
     scoreboard = new Scoreboard(k0, k1, k2);
+    scheduler_policy = create_scheduler_policy(SCHED_OLDEST_FIRST, schedule_queue->size(), 0);
 
     number_of_instructions_to_fetch = f;
     number_of_results_buses = r;
-    inst_count = 0;
+    fetched_count = 0;
+    fetch_stall_cycles = 0;
+    fetch_stall_remaining = 0;
+    fetch_line_filled = false;
+    has_pending_fetch = false;
 
     dispatch_size_per_cycle = 0;
     instructions_fired_per_cycle = 0;
     instructions_retired_per_cycle = 0;
+
+    warmup_instructions = 0;
+    converge_epsilon = 0;
+}
+
+/**
+ * Replaces the default oldest-first scheduler with another selection policy.
+ *
+ * @policy A sched_policy_t
+ * @seed Seed for policies that make random choices
+ */
+void setup_scheduler(int policy, uint64_t seed)
+{
+    delete(scheduler_policy);
+    scheduler_policy = create_scheduler_policy((sched_policy_t) policy, schedule_queue->size(), seed);
+}
+
+/**
+ * Restricts statistics to a measurement window and optionally ends the run early.
+ *
+ * @warmup Instructions to retire before statistics start being collected
+ * @converge_epsilon Stop once the 95% confidence half-width of IPC is within this fraction of it (0 runs to the end)
+ */
+void setup_sampling(uint64_t warmup, double converge_epsilon)
+{
+    warmup_instructions = warmup;
+    ::converge_epsilon = converge_epsilon;
+}
+
+/**
+ * Enables the instruction cache model. Without it fetch takes F instructions every cycle regardless
+ * of their addresses.
+ *
+ * @size Capacity in bytes
+ * @associativity Ways per set
+ * @line_size Line size in bytes
+ * @miss_latency Cycles fetch stalls on a miss
+ */
+void setup_icache(uint64_t size, uint64_t associativity, uint64_t line_size, uint64_t miss_latency)
+{
+    icache = new InstructionCache(size, associativity, line_size, miss_latency);
 }
 
 /**
@@ -61,11 +140,39 @@ void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f)
  */
 void run_proc(proc_stats_t* p_stats)
 {
-    readInstructions();
-    uint64_t goal = instruction_queue->size();
+    run_stage(STAGE_START_PREFETCH, startPrefetch);
+
+    // Statistics only cover cycles after the warm-up, so remember the totals at that point
+    bool warmed_up = false;
+    int warmup_cycles = 0;
+    uint64_t warmup_retired = 0;
+    double warmup_dispatch_size = 0;
+    double warmup_fired = 0;
+    double warmup_retired_count = 0;
+    uint64_t warmup_icache_accesses = 0;
+    uint64_t warmup_icache_hits = 0;
+    uint64_t warmup_fetch_stall_cycles = 0;
+    IpcEstimator ipc_estimator;
+    bool converged = false;
 
     uint64_t max_disp_size = 0;
-    while(completed_instruction_queue->size() != goal){
+    while(completed_instruction_queue->size() != fetched_count || traceRemaining()){
+        if(!warmed_up && completed_instruction_queue->size() >= warmup_instructions){
+            warmed_up = true;
+            warmup_cycles = cycle_count;
+            warmup_retired = completed_instruction_queue->size();
+            warmup_dispatch_size = dispatch_size_per_cycle;
+            warmup_fired = instructions_fired_per_cycle;
+            warmup_retired_count = instructions_retired_per_cycle;
+            if(icache != NULL){
+                warmup_icache_accesses = icache->accesses;
+                warmup_icache_hits = icache->hits;
+            }
+            warmup_fetch_stall_cycles = fetch_stall_cycles;
+            max_disp_size = 0;
+            ipc_estimator.start(warmup_retired);
+        }
+
         ++cycle_count;
 
         //printf("Cycle %d\n", cycle_count);
@@ -74,24 +181,44 @@ void run_proc(proc_stats_t* p_stats)
         }
         dispatch_size_per_cycle += dispatch_queue->size();
 
-        state_update();
-        execute();
-        schedule();
-        dispatch();
-        fetch();
+        run_stage(STAGE_STATE_UPDATE, state_update);
+        run_stage(STAGE_EXECUTE, execute);
+        run_stage(STAGE_SCHEDULE, schedule);
+        run_stage(STAGE_DISPATCH, dispatch);
+        run_stage(STAGE_FETCH, fetch);
 
         //schedule_queue->printQueue();
         //scoreboard->printFunctionUnits();
         //printResultBus();
         //printf("\n\n");
+
+        if(warmed_up && converge_epsilon > 0 && ipc_estimator.endCycle(completed_instruction_queue->size())
+                && ipc_estimator.converged(converge_epsilon)){
+            converged = true;
+            break;
+        }
     }
 
-    p_stats->retired_instruction = completed_instruction_queue->size();
-    p_stats->avg_disp_size = dispatch_size_per_cycle/cycle_count;
+    // A warm-up longer than the trace leaves nothing to measure, so the whole run is reported instead
+    int measured_cycles = cycle_count - warmup_cycles;
+    p_stats->retired_instruction = completed_instruction_queue->size() - warmup_retired;
+    p_stats->avg_disp_size = (dispatch_size_per_cycle - warmup_dispatch_size)/measured_cycles;
     p_stats->max_disp_size = max_disp_size;
-    p_stats->avg_inst_fired = instructions_fired_per_cycle/cycle_count;
-    p_stats->avg_inst_retired = instructions_retired_per_cycle/cycle_count;
+    p_stats->avg_inst_fired = (instructions_fired_per_cycle - warmup_fired)/measured_cycles;
+    p_stats->avg_inst_retired = (instructions_retired_per_cycle - warmup_retired_count)/measured_cycles;
     p_stats->cycle_count = cycle_count;
+    p_stats->measured_cycles = measured_cycles;
+    p_stats->warmup_instructions = warmup_retired;
+    p_stats->simulated_instructions = completed_instruction_queue->size();
+    p_stats->converge_epsilon = converge_epsilon;
+    p_stats->ipc_half_width = converge_epsilon > 0 ? ipc_estimator.halfWidth() : 0;
+    p_stats->converged = converged;
+    if(icache != NULL){
+        p_stats->icache_accesses = icache->accesses - warmup_icache_accesses;
+        p_stats->icache_hits = icache->hits - warmup_icache_hits;
+        p_stats->icache_hit_rate = p_stats->icache_accesses ? (float) p_stats->icache_hits / p_stats->icache_accesses : 0;
+    }
+    p_stats->fetch_stall_cycles = fetch_stall_cycles - warmup_fetch_stall_cycles;
 }
 
 /**
@@ -104,16 +231,19 @@ void run_proc(proc_stats_t* p_stats)
 void complete_proc(proc_stats_t *p_stats)
 {
     sort(completed_instruction_queue->begin(), completed_instruction_queue->end(), sort_by_inst_number);
-    printf("INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
+    fprintf(timing_log, "INST\tFETCH\tDISP\tSCHED\tEXEC\tSTATE\n");
     for(auto inst : *completed_instruction_queue){
-        printf("%d\t%d\t%d\t%d\t%d\t%d\n", inst.inst_number, inst.fetch, inst.disp, inst.sched, inst.exec, inst.state);
+        fprintf(timing_log, "%d\t%d\t%d\t%d\t%d\t%d\n", inst.inst_number, inst.fetch, inst.disp, inst.sched, inst.exec, inst.state);
     }
-    printf("\n");
+    fprintf(timing_log, "\n");
+    delete(scheduler_policy);
     delete(scoreboard);
     delete(schedule_queue);
     delete(register_file);
     delete(result_buses);
-    delete(instruction_queue);
+    delete(trace_prefetcher);
+    delete(icache);
+    icache = NULL;
     delete(dispatch_queue);
     delete(completed_instruction_queue);
 }
@@ -176,23 +306,54 @@ void dispatch(){
             break;
         }
     }
-
-    schedule_queue->sort();
 }
 
 /**
  * Fetch function of the processor:
- *      Fetches F instructions from the instruction queue and puts them in the dispatch queue.
+ *      Fetches up to F instructions from the trace prefetcher and puts them in the dispatch queue.
+ *      With an instruction cache, fetch stalls while a missing line is filled and stops at the end
+ *      of the line it started in.
  */
 void fetch(){
-    if(!instruction_queue->empty()){
-        for(int i = 0; i < number_of_instructions_to_fetch; ++i){
-            proc_inst_t fetched_inst = instruction_queue->front();
-            fetched_inst.fetch = cycle_count;
-            fetched_inst.disp = cycle_count + 1;
-            dispatch_queue->push_back(fetched_inst);
-            instruction_queue->erase(instruction_queue->begin());
+    uint64_t fetch_line = 0;
+    if(icache != NULL){
+        if(fetch_stall_remaining > 0){
+            --fetch_stall_remaining;
+            ++fetch_stall_cycles;
+            return;
+        }
+        if(!fetchNextInstruction(&pending_fetch)){
+            return;
         }
+        has_pending_fetch = true;
+
+        // The block that missed was already looked up and its line filled during the stall
+        fetch_line = icache->lineOf(pending_fetch.instruction_address);
+        if(fetch_line_filled){
+            fetch_line_filled = false;
+        }
+        else if(!icache->access(fetch_line) && icache->miss_latency > 0){
+            fetch_stall_remaining = icache->miss_latency - 1;
+            fetch_line_filled = true;
+            ++fetch_stall_cycles;
+            return;
+        }
+    }
+
+    proc_inst_t fetched_inst;
+    for(int i = 0; i < number_of_instructions_to_fetch; ++i){
+        if(!fetchNextInstruction(&fetched_inst)){
+            break;
+        }
+        if(icache != NULL && icache->lineOf(fetched_inst.instruction_address) != fetch_line){
+            pending_fetch = fetched_inst;
+            has_pending_fetch = true;
+            break;
+        }
+        fetched_inst.fetch = cycle_count;
+        fetched_inst.disp = cycle_count + 1;
+        dispatch_queue->push_back(fetched_inst);
+        ++fetched_count;
     }
 }
 
@@ -253,22 +414,39 @@ void initReservationStation(reservation_station* entry){
     }
 
     current_slot->dest_reg_tag = inst.tag;
+
+    int slot = schedule_queue->slotOf(current_slot);
+    scheduler_policy->dispatched(slot, *current_slot);
+    if(current_slot->src1_ready && current_slot->src2_ready && current_slot->fu >= 0 && current_slot->fu < NUM_FU_TYPES){
+        scheduler_policy->ready(slot, current_slot->fu);
+    }
 }
 
 /**
- * Reads all instructions from the trace file into instruction_queue.
+ * Starts decoding the trace in the background for fetch() to consume.
  */
-void readInstructions(){
-    proc_inst_t* current_instruction = new proc_inst_t();
-    while(read_instruction(current_instruction)){
-        ++inst_count;
-        current_instruction->tag = inst_count;
-        current_instruction->inst_number = inst_count;
-        if(current_instruction->op_code == -1){
-            current_instruction->op_code = 1;
-        }
-        instruction_queue->push_back(*current_instruction);
+void startPrefetch(){
+    trace_prefetcher->start();
+}
+
+/**
+ * Takes the next instruction in trace order, including one fetch() held back at a line boundary.
+ */
+bool fetchNextInstruction(proc_inst_t* inst){
+    if(has_pending_fetch){
+        *inst = pending_fetch;
+        has_pending_fetch = false;
+        return true;
     }
+
+    return trace_prefetcher->next(inst);
+}
+
+/**
+ * Returns true while there are instructions left to fetch.
+ */
+bool traceRemaining(){
+    return has_pending_fetch || trace_prefetcher->hasNext();
 }
 
 /**
@@ -303,6 +481,7 @@ vector<reservation_station*>* SchedulingQueue::getUnusedSlots(vector<proc_inst_t
 void SchedulingQueue::deleteInstructions(){
     for(auto& entry : *scheduling_queue){
         if(entry.mark_for_delete){
+            scheduler_policy->deleted(slotOf(&entry));
             entry.in_use = false;
             entry.fired = 0;
             entry.completed = 0;
@@ -326,10 +505,13 @@ void SchedulingQueue::markCompletedInstructionsForDeletion(){
 }
 
 /**
- * Reads the result buses and updates the scheduling queue accordingly.
+ * Reads the result buses and updates the scheduling queue accordingly, telling the scheduler policy
+ * about instructions whose last source just arrived.
  */
 void SchedulingQueue::readResultBuses(vector<result_bus>* result_buses){
     for(auto& entry : *scheduling_queue){
+        bool waiting = !entry.src1_ready || !entry.src2_ready;
+
         if(!entry.src1_ready){
             for(auto bus : *result_buses){
                 if(bus.busy && bus.tag == entry.src1_tag){
@@ -356,6 +538,10 @@ void SchedulingQueue::readResultBuses(vector<result_bus>* result_buses){
 
             }
         }
+
+        if(waiting && entry.in_use && entry.src1_ready && entry.src2_ready && entry.fu >= 0 && entry.fu < NUM_FU_TYPES){
+            scheduler_policy->ready(slotOf(&entry), entry.fu);
+        }
     }
 
     for(auto& bus : *result_buses){
@@ -364,27 +550,30 @@ void SchedulingQueue::readResultBuses(vector<result_bus>* result_buses){
 }
 
 /**
- * Fires any instructions that are ready to fire and have an available function unit.
+ * Fires ready instructions while there are available function units for them, in the order the
+ * scheduler policy chooses.
  */
 void SchedulingQueue::fireInstructions(Scoreboard* scoreboard){
-    for(auto& entry : *scheduling_queue){
-        if(entry.in_use && entry.src1_ready && entry.src2_ready && !entry.fired){
-            function_unit* fu_to_use;
-            bool found_available_fu = scoreboard->reserveAvailableFunctionUnit(entry.fu, fu_to_use);
-
-            if(found_available_fu){
-                ++instructions_fired_per_cycle;
-                //printf("firing instruction %lld\n", entry.dest_reg_tag);
-                fu_to_use->busy = true;
-                fu_to_use->tag = entry.dest_reg_tag;
-                fu_to_use->register_number = entry.dest_reg;
-                fu_to_use->completed = false;
-                fu_to_use->original_instruction = &entry.original_instruction;
-                fu_to_use->cycles_stalled = 0;
-
-                entry.fired = true;
-                entry.original_instruction.exec = cycle_count + 1;
+    for(int type = 0; type < NUM_FU_TYPES; ++type){
+        function_unit* fu_to_use;
+        while(scoreboard->reserveAvailableFunctionUnit(type, fu_to_use)){
+            int slot = scheduler_policy->selectToFire(type);
+            if(slot == -1){
+                break;
             }
+
+            reservation_station& entry = scheduling_queue->at(slot);
+            ++instructions_fired_per_cycle;
+            //printf("firing instruction %lld\n", entry.dest_reg_tag);
+            fu_to_use->busy = true;
+            fu_to_use->tag = entry.dest_reg_tag;
+            fu_to_use->register_number = entry.dest_reg;
+            fu_to_use->completed = false;
+            fu_to_use->original_instruction = &entry.original_instruction;
+            fu_to_use->cycles_stalled = 0;
+
+            entry.fired = true;
+            entry.original_instruction.exec = cycle_count + 1;
         }
     }
 
@@ -392,27 +581,18 @@ void SchedulingQueue::fireInstructions(Scoreboard* scoreboard){
 }
 
 /**
- * Put any completed function units results on any available result buses, giving priority to instructions that have stalled the longest and then tag order.
+ * Put any completed function units results on any available result buses, in the order the scheduler policy chooses
+ * (by default the instructions that have stalled the longest and then tag order).
  */
 void Scoreboard::broadcastCompletedInstructions(){
     for(auto& rb : *result_buses){
         if(!rb.busy && !completed_function_units->empty()){
-            function_unit* lowestCompletedTag = &completed_function_units->front();
-            for(auto& fu : *completed_function_units){
-                if(fu.cycles_stalled > lowestCompletedTag->cycles_stalled){
-                    lowestCompletedTag = &fu;
-                }
-                else if(fu.cycles_stalled == lowestCompletedTag->cycles_stalled){
-                    if(fu.tag < lowestCompletedTag->tag){
-                        lowestCompletedTag = &fu;
-                    }
-                }
-            }
+            function_unit* selected = scheduler_policy->selectBroadcast(completed_function_units);
 
             rb.busy = true;
-            rb.tag = lowestCompletedTag->tag;
-            rb.register_number = lowestCompletedTag->register_number;
-            lowestCompletedTag->busy = false;
+            rb.tag = selected->tag;
+            rb.register_number = selected->register_number;
+            selected->busy = false;
 
             updateFunctionUnitQueues();
         }
@@ -436,6 +616,35 @@ bool Scoreboard::reserveAvailableFunctionUnit(int k, function_unit*& fu){
     return found;
 }
 
+/**
+ * Looks up a line, filling it over the least recently used way on a miss. Returns true on a hit.
+ */
+bool InstructionCache::access(uint64_t line){
+    ++accesses;
+    if(line == last_line){
+        ++hits;
+        return true;
+    }
+    last_line = line;
+
+    uint64_t base = (line & (sets - 1)) * associativity;
+    uint64_t victim = base;
+    for(uint64_t way = base; way < base + associativity; ++way){
+        if(lines[way] == line + 1){
+            last_used[way] = accesses;
+            ++hits;
+            return true;
+        }
+        if(last_used[way] < last_used[victim]){
+            victim = way;
+        }
+    }
+
+    lines[victim] = line + 1;
+    last_used[victim] = accesses;
+    return false;
+}
+
 /**
  * Updates the register file with what is on the result buses.
  */
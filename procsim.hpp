@@ -2,12 +2,14 @@
 #define PROCSIM_HPP
 
 #include <cstdint>
+#include <cmath>
 #include <stdint.h>
 #include <cstdio>
 #include <vector>
 #include <memory>
 #include <algorithm>
 #include <iostream>
+#include "self_profile.hpp"
 
 using namespace std;
 
@@ -17,6 +19,20 @@ using namespace std;
 #define DEFAULT_R 8
 #define DEFAULT_F 4
 
+#define NUM_REGISTERS 128
+#define NUM_FU_TYPES 3
+
+#define DEFAULT_ICACHE_ASSOC 4
+#define DEFAULT_ICACHE_LINE 64
+#define DEFAULT_ICACHE_LATENCY 10
+
+// --converge measures IPC over batches of this many cycles and needs this many batches before stopping
+#define CONVERGE_BATCH_CYCLES 1000
+#define CONVERGE_MIN_BATCHES 10
+
+// Bump whenever a change alters simulation results or proc_stats_t, so cached results are not reused
+#define PROCSIM_VERSION 4
+
 typedef struct _proc_inst_t
 {
     uint32_t instruction_address;
@@ -43,6 +59,16 @@ typedef struct _proc_stats_t
     unsigned long max_disp_size;
     unsigned long retired_instruction;
     unsigned long cycle_count;
+    unsigned long icache_accesses;
+    unsigned long icache_hits;
+    float icache_hit_rate;
+    unsigned long fetch_stall_cycles;
+    unsigned long measured_cycles;
+    unsigned long warmup_instructions;
+    unsigned long simulated_instructions;
+    float converge_epsilon;
+    float ipc_half_width;
+    bool converged;
 } proc_stats_t;
 
 typedef struct reg
@@ -94,6 +120,8 @@ typedef struct {
     int register_number;
 } result_bus;
 
+class SchedulerPolicy;
+
 class Scoreboard {
     vector<function_unit>* available_function_units;
     vector<function_unit>* busy_function_units;
@@ -227,20 +255,134 @@ class SchedulingQueue {
     void readResultBuses(vector<result_bus>* result_buses);
     vector<reservation_station*>* getUnusedSlots(vector<proc_inst_t>* dispatch_queue);
     void fireInstructions(Scoreboard* scoreboard);
-    static bool sort_by_tag(reservation_station rs1, reservation_station rs2){
-        return rs1.dest_reg_tag < rs2.dest_reg_tag;
+    int size(){
+        return queue_size;
     }
-    void sort(){
-        std::sort(scheduling_queue->begin(), scheduling_queue->end(), sort_by_tag);
+    int slotOf(reservation_station* entry){
+        return entry - &scheduling_queue->front();
     }
 };
 
-bool read_instruction(proc_inst_t* p_inst);
+/**
+ * Set-associative LRU instruction cache indexed by trace instruction addresses. Fetch accesses it
+ * once per cycle for the line it fetches from; a miss fills the line and stalls fetch for the miss
+ * latency.
+ */
+class InstructionCache {
+    vector<uint64_t> lines;
+    vector<uint64_t> last_used;
+    uint64_t sets;
+    uint64_t associativity;
+    int line_shift;
+    uint64_t last_line;
+
+    public:
+    uint64_t miss_latency;
+    uint64_t accesses;
+    uint64_t hits;
+
+    InstructionCache(uint64_t size, uint64_t associativity, uint64_t line_size, uint64_t miss_latency){
+        this->associativity = associativity;
+        this->miss_latency = miss_latency;
+        sets = size / (line_size * associativity);
+        line_shift = 0;
+        while((1ULL << line_shift) < line_size){
+            ++line_shift;
+        }
+
+        // line numbers are stored plus one so zero marks an empty way
+        lines.assign(sets * associativity, 0);
+        last_used.assign(sets * associativity, 0);
+        last_line = ~0ULL;
+        accesses = 0;
+        hits = 0;
+    }
+
+    uint64_t lineOf(uint32_t address){
+        return address >> line_shift;
+    }
+    bool access(uint64_t line);
+};
+
+/**
+ * Two-sided 95% Student-t quantile for the given degrees of freedom. Past the table the first two
+ * Cornish-Fisher corrections to the normal quantile are within 0.001 of the exact value.
+ */
+static inline double t_quantile_95(uint64_t degrees_of_freedom){
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if(degrees_of_freedom <= 30){
+        return table[degrees_of_freedom - 1];
+    }
+    const double z = 1.959964;
+    double v = degrees_of_freedom;
+    return z + (z * z * z + z) / (4 * v) + (5 * pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * v * v);
+}
+
+/**
+ * Running estimate of IPC from batch means. Each batch of CONVERGE_BATCH_CYCLES cycles contributes one
+ * IPC sample, and the 95% confidence half-width of their mean says how settled the estimate is.
+ */
+class IpcEstimator {
+    uint64_t batch_cycles;
+    uint64_t batch_start_retired;
+    uint64_t batches;
+    double mean;
+    double sum_squares;
+
+    public:
+    IpcEstimator(){
+        batch_cycles = 0;
+        batch_start_retired = 0;
+        batches = 0;
+        mean = 0;
+        sum_squares = 0;
+    }
+
+    void start(uint64_t retired){
+        batch_start_retired = retired;
+    }
+    bool endCycle(uint64_t retired){
+        if(++batch_cycles < CONVERGE_BATCH_CYCLES){
+            return false;
+        }
+
+        double ipc = (double) (retired - batch_start_retired) / batch_cycles;
+        ++batches;
+        double delta = ipc - mean;
+        mean += delta / batches;
+        sum_squares += delta * (ipc - mean);
+
+        batch_cycles = 0;
+        batch_start_retired = retired;
+        return true;
+    }
+    double halfWidth(){
+        if(batches < 2){
+            return INFINITY;
+        }
+        return t_quantile_95(batches - 1) * sqrt(sum_squares / (batches - 1) / batches);
+    }
+    bool converged(double epsilon){
+        return batches >= CONVERGE_MIN_BATCHES && halfWidth() <= epsilon * mean;
+    }
+};
+
+bool read_trace_block(vector<proc_inst_t>* instructions);
 
 void setup_proc(uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2, uint64_t f);
+void setup_scheduler(int policy, uint64_t seed);
+void setup_sampling(uint64_t warmup, double converge_epsilon);
+void setup_icache(uint64_t size, uint64_t associativity, uint64_t line_size, uint64_t miss_latency);
 void run_proc(proc_stats_t* p_stats);
 void complete_proc(proc_stats_t* p_stats);
 
+extern FILE* timing_log;
+extern SelfProfiler* self_profiler;
+
 bool sort_by_inst_number(proc_inst_t i, proc_inst_t j);
 void state_update();
 void execute();
@@ -248,7 +390,9 @@ void schedule();
 void dispatch();
 void fetch();
 void initReservationStation(reservation_station* entry);
-void readInstructions();
+void startPrefetch();
+bool fetchNextInstruction(proc_inst_t* inst);
+bool traceRemaining();
 void printResultBus();
 
 #endif /* PROCSIM_HPP */
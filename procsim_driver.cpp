@@ -2,10 +2,19 @@
 #include <cinttypes>
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <unistd.h>
+#include <getopt.h>
 #include "procsim.hpp"
+#include "result_cache.hpp"
+#include "trace_parser.hpp"
+#include "trace_analysis.hpp"
+#include "scheduler_policy.hpp"
 
 FILE* inFile = stdin;
+TraceBuffer trace;
+TraceReader* trace_reader = NULL;
 
 void print_help_and_exit(void) {
     printf("procsim [OPTIONS]\n");
@@ -15,31 +24,28 @@ void print_help_and_exit(void) {
     printf("  -f N\t\tNumber of instructions to fetch\n");
     printf("  -r R\t\tNumber of result buses\n");
     printf("  -i traces/file.trace\n");
+    printf("  -c dir\t\tReuse and store results in a cache directory\n");
+    printf("  --self-profile\tReport the host cost of each simulator stage on stderr\n");
+    printf("  --icache-size B\tModel an instruction cache of B bytes (0 disables, the default)\n");
+    printf("  --icache-assoc N\tInstruction cache ways per set (default %d)\n", DEFAULT_ICACHE_ASSOC);
+    printf("  --icache-line B\tInstruction cache line size in bytes (default %d)\n", DEFAULT_ICACHE_LINE);
+    printf("  --icache-latency N\tCycles fetch stalls on an instruction cache miss (default %d)\n", DEFAULT_ICACHE_LATENCY);
+    printf("  --sched-policy P\tInstruction selection policy: oldest (default), critical, roundrobin or random\n");
+    printf("  --sched-seed N\tSeed for the random policy\n");
+    printf("  --warmup N\tLeave the first N retired instructions out of the statistics\n");
+    printf("  --converge E\tStop once IPC is known to within a fraction E at 95%% confidence\n");
+    printf("  --analyze\tReport the trace's dataflow limits for this machine instead of simulating\n");
     printf("  -h\t\tThis helpful output\n");
     exit(0);
 }
 //
-// read_instruction
+// read_trace_block
 //
-//  returns true if an instruction was read successfully
+//  replaces instructions with the next block of the trace, returns false once the trace is exhausted
 //
-bool read_instruction(proc_inst_t* p_inst)
+bool read_trace_block(vector<proc_inst_t>* instructions)
 {
-    int ret;
-
-    if (p_inst == NULL)
-    {
-        fprintf(stderr, "Fetch requires a valid pointer to populate\n");
-        return false;
-    }
-
-    ret = fscanf(stdin, "%x %d %d %d %d\n", &p_inst->instruction_address,
-                 &p_inst->op_code, &p_inst->dest_reg, &p_inst->src_reg[0], &p_inst->src_reg[1]);
-    if (ret != 5) {
-        return false;
-    }
-
-    return true;
+    return trace_reader->next(instructions);
 }
 
 void print_statistics(proc_stats_t* p_stats);
@@ -51,9 +57,34 @@ int main(int argc, char* argv[]) {
     uint64_t k1 = DEFAULT_K1;
     uint64_t k2 = DEFAULT_K2;
     uint64_t r = DEFAULT_R;
+    const char* cache_dir = NULL;
+    bool self_profile = false;
+    bool analyze = false;
+    uint64_t icache_size = 0;
+    uint64_t icache_assoc = DEFAULT_ICACHE_ASSOC;
+    uint64_t icache_line = DEFAULT_ICACHE_LINE;
+    uint64_t icache_latency = DEFAULT_ICACHE_LATENCY;
+    sched_policy_t sched_policy = SCHED_OLDEST_FIRST;
+    uint64_t sched_seed = 1;
+    uint64_t warmup = 0;
+    double converge_epsilon = 0;
+
+    static struct option long_options[] = {
+        {"self-profile", no_argument, NULL, 'P'},
+        {"analyze", no_argument, NULL, 'A'},
+        {"icache-size", required_argument, NULL, 'S'},
+        {"icache-assoc", required_argument, NULL, 'W'},
+        {"icache-line", required_argument, NULL, 'L'},
+        {"icache-latency", required_argument, NULL, 'T'},
+        {"sched-policy", required_argument, NULL, 'p'},
+        {"sched-seed", required_argument, NULL, 's'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"converge", required_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0}
+    };
 
     /* Read arguments */
-    while(-1 != (opt = getopt(argc, argv, "r:i:j:k:l:f:h"))) {
+    while(-1 != (opt = getopt_long(argc, argv, "r:i:j:k:l:f:c:h", long_options, NULL))) {
         switch(opt) {
         case 'r':
             r = atoi(optarg);
@@ -78,6 +109,46 @@ int main(int argc, char* argv[]) {
                 print_help_and_exit();
             }
             break;
+        case 'c':
+            cache_dir = optarg;
+            break;
+        case 'P':
+            self_profile = true;
+            break;
+        case 'A':
+            analyze = true;
+            break;
+        case 'S':
+            icache_size = atoi(optarg);
+            break;
+        case 'W':
+            icache_assoc = atoi(optarg);
+            break;
+        case 'L':
+            icache_line = atoi(optarg);
+            break;
+        case 'T':
+            icache_latency = atoi(optarg);
+            break;
+        case 'p':
+            if (!parse_sched_policy(optarg, &sched_policy)) {
+                fprintf(stderr, "Unknown scheduler policy %s\n", optarg);
+                print_help_and_exit();
+            }
+            break;
+        case 's':
+            sched_seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            warmup = strtoull(optarg, NULL, 0);
+            break;
+        case 'e':
+            converge_epsilon = atof(optarg);
+            if (converge_epsilon <= 0) {
+                fprintf(stderr, "--converge needs a positive relative error\n");
+                print_help_and_exit();
+            }
+            break;
         case 'h':
             /* Fall through */
         default:
@@ -86,6 +157,15 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (icache_size != 0) {
+        uint64_t sets = (icache_line && icache_assoc) ? icache_size / (icache_line * icache_assoc) : 0;
+        if (sets == 0 || (sets & (sets - 1)) != 0 || (icache_line & (icache_line - 1)) != 0
+                || sets * icache_line * icache_assoc != icache_size) {
+            fprintf(stderr, "Instruction cache size / (line size * ways) must be a power of two, as must the line size\n");
+            print_help_and_exit();
+        }
+    }
+
     printf("Processor Settings\n");
     printf("R: %" PRIu64 "\n", r);
     printf("k0: %" PRIu64 "\n", k0);
@@ -94,21 +174,122 @@ int main(int argc, char* argv[]) {
     printf("F: %"  PRIu64 "\n", f);
     printf("\n");
 
-    /* Setup the processor */
-    setup_proc(r, k0, k1, k2, f);
-
     /* Setup statistics */
     proc_stats_t stats;
     memset(&stats, 0, sizeof(proc_stats_t));
 
+    /* The whole trace is only needed up front to hash or analyze it. Otherwise regular files are
+       mapped and anything else is streamed while the simulation runs. */
+    if (analyze || (cache_dir != NULL && !self_profile)) {
+        if (!trace.load(inFile)) {
+            fprintf(stderr, "Failed to read the trace\n");
+            return 1;
+        }
+    }
+    else {
+        trace.map(inFile);
+    }
+
+    if (analyze) {
+        vector<proc_inst_t> instructions;
+        parse_trace(trace.data(), trace.size(), &instructions, default_parse_threads());
+
+        trace_analysis_t analysis;
+        analyze_trace(instructions, r, k0, k1, k2, f, default_parse_threads(), &analysis);
+        print_analysis(stdout, &analysis);
+        return 0;
+    }
+
+    /* Return cached results for this trace and configuration if there are any. A profiled run always
+       simulates, since the point is to measure the simulation. */
+    ResultCache* cache = NULL;
+    cache_key key;
+    char* log_buffer = NULL;
+    size_t log_size = 0;
+    if (cache_dir != NULL && !self_profile) {
+        char config[128];
+        snprintf(config, sizeof(config), "R=%" PRIu64 " k0=%" PRIu64 " k1=%" PRIu64 " k2=%" PRIu64 " F=%" PRIu64,
+                 r, k0, k1, k2, f);
+        key.trace_hash = hash_trace(trace.data(), trace.size());
+        key.trace_size = trace.size();
+        key.config = config;
+        if (icache_size != 0) {
+            snprintf(config, sizeof(config), " icache=%" PRIu64 ":%" PRIu64 ":%" PRIu64 ":%" PRIu64,
+                     icache_size, icache_assoc, icache_line, icache_latency);
+            key.config += config;
+        }
+        if (sched_policy != SCHED_OLDEST_FIRST) {
+            snprintf(config, sizeof(config), " sched=%s", sched_policy_name(sched_policy));
+            key.config += config;
+            if (sched_policy == SCHED_RANDOM) {
+                snprintf(config, sizeof(config), ":%" PRIu64, sched_seed);
+                key.config += config;
+            }
+        }
+        if (warmup != 0) {
+            snprintf(config, sizeof(config), " warmup=%" PRIu64, warmup);
+            key.config += config;
+        }
+        if (converge_epsilon != 0) {
+            snprintf(config, sizeof(config), " converge=%.17g", converge_epsilon);
+            key.config += config;
+        }
+
+        cache = new ResultCache(cache_dir);
+        string cached_log;
+        if (cache->load(key, &stats, &cached_log)) {
+            fwrite(cached_log.data(), 1, cached_log.size(), stdout);
+            print_statistics(&stats);
+            delete(cache);
+            return 0;
+        }
+
+        timing_log = open_memstream(&log_buffer, &log_size);
+    }
+
+    if (self_profile) {
+        self_profiler = new SelfProfiler();
+    }
+
+    /* Setup the processor */
+    trace_reader = new TraceReader(&trace, inFile);
+    setup_proc(r, k0, k1, k2, f);
+    if (sched_policy != SCHED_OLDEST_FIRST) {
+        setup_scheduler(sched_policy, sched_seed);
+    }
+    if (icache_size != 0) {
+        setup_icache(icache_size, icache_assoc, icache_line, icache_latency);
+    }
+    if (warmup != 0 || converge_epsilon != 0) {
+        setup_sampling(warmup, converge_epsilon);
+    }
+
     /* Run the processor */
     run_proc(&stats);
 
     /* Finalize stats */
     complete_proc(&stats);
+    if (warmup != 0 && stats.warmup_instructions == 0) {
+        fprintf(stderr, "The trace ended during the warm-up, reporting the whole run\n");
+    }
+    delete(trace_reader);
+
+    if (cache != NULL) {
+        fclose(timing_log);
+        timing_log = stdout;
+        fwrite(log_buffer, 1, log_size, stdout);
+        cache->store(key, &stats, string(log_buffer, log_size));
+        free(log_buffer);
+        delete(cache);
+    }
 
     print_statistics(&stats);
 
+    if (self_profiler != NULL) {
+        self_profiler->report(stderr, stats.simulated_instructions);
+        delete(self_profiler);
+    }
+
     return 0;
 }
 
@@ -120,5 +301,19 @@ void print_statistics(proc_stats_t* p_stats) {
         printf("Avg inst fired per cycle: %f\n", p_stats->avg_inst_fired);
 	printf("Avg inst retired per cycle: %f\n", p_stats->avg_inst_retired);
 	printf("Total run time (cycles): %lu\n", p_stats->cycle_count);
+        if (p_stats->icache_accesses != 0) {
+            printf("I-cache accesses: %lu\n", p_stats->icache_accesses);
+            printf("I-cache hit rate: %f\n", p_stats->icache_hit_rate);
+            printf("Fetch stall cycles: %lu\n", p_stats->fetch_stall_cycles);
+        }
+        if (p_stats->warmup_instructions != 0 || p_stats->converge_epsilon != 0) {
+            printf("Warm-up instructions excluded: %lu\n", p_stats->warmup_instructions);
+            printf("Instructions simulated: %lu\n", p_stats->simulated_instructions);
+            printf("Measured cycles: %lu\n", p_stats->measured_cycles);
+        }
+        if (p_stats->converge_epsilon != 0) {
+            printf("IPC 95%% confidence half-width: %f\n", p_stats->ipc_half_width);
+            printf("Converged early: %s\n", p_stats->converged ? "yes" : "no");
+        }
 }
 
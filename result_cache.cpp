@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "result_cache.hpp"
+
+#define CACHE_MAGIC "PSCACHE"
+
+typedef struct cache_header{
+    char magic[8];
+    uint32_t version;
+    uint32_t stats_size;
+    uint64_t trace_hash;
+    uint64_t trace_size;
+    uint64_t config_size;
+    uint64_t log_size;
+} cache_header;
+
+static inline uint64_t mix(uint64_t h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Fast 64-bit content hash of a trace. Consumes 32 bytes per step in four independent lanes so the
+ * multiplies overlap, then folds the lanes and the tail together.
+ */
+uint64_t hash_trace(const char* data, size_t size){
+    const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+    uint64_t lanes[4] = {prime, prime << 1, prime << 2, prime << 3};
+    size_t i = 0;
+
+    for(; i + 32 <= size; i += 32){
+        for(int lane = 0; lane < 4; ++lane){
+            uint64_t word;
+            memcpy(&word, data + i + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+
+    uint64_t h = size;
+    for(int lane = 0; lane < 4; ++lane){
+        h = mix(h ^ lanes[lane]);
+    }
+    for(; i < size; ++i){
+        h = (h ^ (unsigned char) data[i]) * prime;
+    }
+
+    return mix(h);
+}
+
+/**
+ * Cache file for a key: the name covers the trace, the configuration and the simulator version so
+ * files from older simulators are simply never looked up.
+ */
+string ResultCache::pathFor(const cache_key& key){
+    uint64_t h = mix(key.trace_hash ^ PROCSIM_VERSION);
+    h = mix(h ^ hash_trace(key.config.data(), key.config.size()));
+
+    char name[64];
+    snprintf(name, sizeof(name), "/%016" PRIx64 "-%016" PRIx64 ".stats", key.trace_hash, h);
+    return cache_dir + name;
+}
+
+/**
+ * Looks up a key, filling in the statistics and timing log on a hit. Anything unreadable, truncated or
+ * belonging to a different key is treated as a miss.
+ */
+bool ResultCache::load(const cache_key& key, proc_stats_t* p_stats, string* timing_log){
+    FILE* file = fopen(pathFor(key).c_str(), "rb");
+    if(file == NULL){
+        return false;
+    }
+
+    bool hit = false;
+    cache_header header;
+    if(fread(&header, sizeof(header), 1, file) == 1
+            && memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == PROCSIM_VERSION
+            && header.stats_size == sizeof(proc_stats_t)
+            && header.trace_hash == key.trace_hash
+            && header.trace_size == key.trace_size
+            && header.config_size == key.config.size()){
+        string config(header.config_size, '\0');
+        proc_stats_t stats;
+        string log(header.log_size, '\0');
+
+        if(fread(&config[0], 1, config.size(), file) == config.size() && config == key.config
+                && fread(&stats, sizeof(stats), 1, file) == 1
+                && fread(&log[0], 1, log.size(), file) == log.size()){
+            *p_stats = stats;
+            timing_log->swap(log);
+            hit = true;
+        }
+    }
+
+    fclose(file);
+    return hit;
+}
+
+/**
+ * Stores the results for a key. The file is written under a private temporary name and renamed into
+ * place, so concurrent runs sharing cache_dir only ever see complete entries.
+ */
+bool ResultCache::store(const cache_key& key, const proc_stats_t* p_stats, const string& timing_log){
+    string path = pathFor(key);
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp.%ld", (long) getpid());
+    string tmp_path = path + suffix;
+
+    if(mkdir(cache_dir.c_str(), 0777) != 0 && errno != EEXIST){
+        fprintf(stderr, "Failed to create cache directory %s\n", cache_dir.c_str());
+        return false;
+    }
+
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if(file == NULL){
+        fprintf(stderr, "Failed to open %s for writing\n", tmp_path.c_str());
+        return false;
+    }
+
+    cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = PROCSIM_VERSION;
+    header.stats_size = sizeof(proc_stats_t);
+    header.trace_hash = key.trace_hash;
+    header.trace_size = key.trace_size;
+    header.config_size = key.config.size();
+    header.log_size = timing_log.size();
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(key.config.data(), 1, key.config.size(), file) == key.config.size()
+        && fwrite(p_stats, sizeof(proc_stats_t), 1, file) == 1
+        && fwrite(timing_log.data(), 1, timing_log.size(), file) == timing_log.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if(!ok || rename(tmp_path.c_str(), path.c_str()) != 0){
+        fprintf(stderr, "Failed to write cache entry %s\n", path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
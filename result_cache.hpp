@@ -0,0 +1,38 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include "procsim.hpp"
+
+/**
+ * Identifies one simulation point: the trace contents plus every setting that can change the results.
+ * The simulator version is folded in by the cache itself.
+ */
+typedef struct cache_key{
+    uint64_t trace_hash;
+    uint64_t trace_size;
+    string config;
+} cache_key;
+
+uint64_t hash_trace(const char* data, size_t size);
+
+/**
+ * Persistent on-disk cache of final statistics and timing logs, one file per key in cache_dir.
+ */
+class ResultCache {
+    string cache_dir;
+
+    public:
+    ResultCache(const string& cache_dir){
+        this->cache_dir = cache_dir;
+    }
+
+    bool load(const cache_key& key, proc_stats_t* p_stats, string* timing_log);
+    bool store(const cache_key& key, const proc_stats_t* p_stats, const string& timing_log);
+
+    private:
+    string pathFor(const cache_key& key);
+};
+
+#endif /* RESULT_CACHE_HPP */
@@ -0,0 +1,195 @@
+#include <cstring>
+#include "scheduler_policy.hpp"
+
+static const char* policy_names[] = {"oldest", "critical", "roundrobin", "random"};
+
+/**
+ * True if a should get a result bus before b under the original rule: longest stalled, then oldest.
+ */
+static inline bool stalled_longer(const function_unit& a, const function_unit& b){
+    if(a.cycles_stalled != b.cycles_stalled){
+        return a.cycles_stalled > b.cycles_stalled;
+    }
+    return a.tag < b.tag;
+}
+
+/**
+ * Put the completed unit that has stalled the longest, and then the one with the lowest tag, on the next bus.
+ */
+function_unit* SchedulerPolicy::selectBroadcast(vector<function_unit>* completed_units){
+    function_unit* selected = &completed_units->front();
+    for(auto& fu : *completed_units){
+        if(stalled_longer(fu, *selected)){
+            selected = &fu;
+        }
+    }
+
+    return selected;
+}
+
+OldestFirstPolicy::OldestFirstPolicy(int slots) : SchedulerPolicy(slots){
+    older compare = {&slot_tag};
+    ready_heaps.assign(NUM_FU_TYPES, IndexedHeap<older>(slots, compare));
+}
+
+void OldestFirstPolicy::ready(int slot, int fu_type){
+    ready_heaps[fu_type].push(slot);
+}
+
+int OldestFirstPolicy::selectToFire(int fu_type){
+    if(ready_heaps[fu_type].empty()){
+        return -1;
+    }
+    return ready_heaps[fu_type].pop();
+}
+
+CriticalPathPolicy::CriticalPathPolicy(int slots) : SchedulerPolicy(slots), dependents(slots, 0), slot_type(slots, 0){
+    more_critical compare = {&slot_tag, &dependents};
+    ready_heaps.assign(NUM_FU_TYPES, IndexedHeap<more_critical>(slots, compare));
+}
+
+/**
+ * Records the new entry and credits the in-flight producers of any sources it is still waiting on.
+ */
+void CriticalPathPolicy::dispatched(int slot, const reservation_station& entry){
+    SchedulerPolicy::dispatched(slot, entry);
+    dependents[slot] = 0;
+    slot_type[slot] = entry.fu;
+    tag_slot[entry.dest_reg_tag] = slot;
+
+    if(!entry.src1_ready){
+        addDependent(entry.src1_tag);
+    }
+    if(!entry.src2_ready){
+        addDependent(entry.src2_tag);
+    }
+}
+
+void CriticalPathPolicy::addDependent(uint64_t producer_tag){
+    auto producer = tag_slot.find(producer_tag);
+    if(producer == tag_slot.end()){
+        return;
+    }
+
+    int slot = producer->second;
+    ++dependents[slot];
+    IndexedHeap<more_critical>& heap = ready_heaps[slot_type[slot]];
+    if(heap.contains(slot)){
+        heap.update(slot);
+    }
+}
+
+void CriticalPathPolicy::deleted(int slot){
+    tag_slot.erase(slot_tag[slot]);
+    dependents[slot] = 0;
+}
+
+void CriticalPathPolicy::ready(int slot, int fu_type){
+    ready_heaps[fu_type].push(slot);
+}
+
+int CriticalPathPolicy::selectToFire(int fu_type){
+    if(ready_heaps[fu_type].empty()){
+        return -1;
+    }
+    return ready_heaps[fu_type].pop();
+}
+
+/**
+ * Put the completed unit whose result the most queued instructions are waiting on on the next bus,
+ * falling back to the original order between equals.
+ */
+function_unit* CriticalPathPolicy::selectBroadcast(vector<function_unit>* completed_units){
+    function_unit* selected = NULL;
+    int selected_dependents = -1;
+    for(auto& fu : *completed_units){
+        auto producer = tag_slot.find(fu.tag);
+        int fu_dependents = (producer == tag_slot.end()) ? 0 : dependents[producer->second];
+        if(fu_dependents > selected_dependents
+                || (fu_dependents == selected_dependents && stalled_longer(fu, *selected))){
+            selected = &fu;
+            selected_dependents = fu_dependents;
+        }
+    }
+
+    return selected;
+}
+
+/**
+ * Give the next bus to the next function unit type after the last one served that has a completed
+ * unit, choosing within the type by the original order.
+ */
+function_unit* RoundRobinPolicy::selectBroadcast(vector<function_unit>* completed_units){
+    for(int offset = 0; offset < NUM_FU_TYPES; ++offset){
+        int type = (next_type + offset) % NUM_FU_TYPES;
+        function_unit* selected = NULL;
+        for(auto& fu : *completed_units){
+            if(fu.type == type && (selected == NULL || stalled_longer(fu, *selected))){
+                selected = &fu;
+            }
+        }
+
+        if(selected != NULL){
+            next_type = (type + 1) % NUM_FU_TYPES;
+            return selected;
+        }
+    }
+
+    return SchedulerPolicy::selectBroadcast(completed_units);
+}
+
+RandomPolicy::RandomPolicy(int slots, uint64_t seed) : SchedulerPolicy(slots), ready_slots(NUM_FU_TYPES), generator(seed){
+}
+
+void RandomPolicy::ready(int slot, int fu_type){
+    ready_slots[fu_type].push_back(slot);
+}
+
+/**
+ * Picks a ready slot uniformly at random, filling the hole with the last ready slot.
+ */
+int RandomPolicy::selectToFire(int fu_type){
+    vector<int>& slots = ready_slots[fu_type];
+    if(slots.empty()){
+        return -1;
+    }
+
+    size_t pick = generator() % slots.size();
+    int slot = slots[pick];
+    slots[pick] = slots.back();
+    slots.pop_back();
+    return slot;
+}
+
+function_unit* RandomPolicy::selectBroadcast(vector<function_unit>* completed_units){
+    return &(*completed_units)[generator() % completed_units->size()];
+}
+
+bool parse_sched_policy(const char* name, sched_policy_t* policy){
+    for(int i = SCHED_OLDEST_FIRST; i <= SCHED_RANDOM; ++i){
+        if(strcmp(name, policy_names[i]) == 0){
+            *policy = (sched_policy_t) i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* sched_policy_name(sched_policy_t policy){
+    return policy_names[policy];
+}
+
+SchedulerPolicy* create_scheduler_policy(sched_policy_t policy, int slots, uint64_t seed){
+    switch(policy){
+    case SCHED_CRITICAL_PATH:
+        return new CriticalPathPolicy(slots);
+    case SCHED_ROUND_ROBIN:
+        return new RoundRobinPolicy(slots);
+    case SCHED_RANDOM:
+        return new RandomPolicy(slots, seed);
+    case SCHED_OLDEST_FIRST:
+    default:
+        return new OldestFirstPolicy(slots);
+    }
+}
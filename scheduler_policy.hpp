@@ -0,0 +1,198 @@
+#ifndef SCHEDULER_POLICY_HPP
+#define SCHEDULER_POLICY_HPP
+
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "procsim.hpp"
+
+typedef enum {
+    SCHED_OLDEST_FIRST,
+    SCHED_CRITICAL_PATH,
+    SCHED_ROUND_ROBIN,
+    SCHED_RANDOM
+} sched_policy_t;
+
+/**
+ * Binary heap of scheduling queue slots that also tracks where each slot sits, so a slot whose
+ * priority changed can be re-sifted in place. Higher says whether one slot should fire before another.
+ */
+template<typename Higher>
+class IndexedHeap {
+    vector<int> heap;
+    vector<int> position;
+    Higher higher;
+
+    public:
+    IndexedHeap(int slots, Higher higher) : position(slots, -1), higher(higher){
+    }
+
+    bool empty(){
+        return heap.empty();
+    }
+    bool contains(int slot){
+        return position[slot] != -1;
+    }
+    int top(){
+        return heap.front();
+    }
+    void push(int slot){
+        position[slot] = heap.size();
+        heap.push_back(slot);
+        siftUp(position[slot]);
+    }
+    int pop(){
+        int slot = heap.front();
+        swapNodes(0, heap.size() - 1);
+        heap.pop_back();
+        position[slot] = -1;
+        if(!heap.empty()){
+            siftDown(0);
+        }
+        return slot;
+    }
+    void update(int slot){
+        siftUp(position[slot]);
+        siftDown(position[slot]);
+    }
+
+    private:
+    void swapNodes(int i, int j){
+        swap(heap[i], heap[j]);
+        position[heap[i]] = i;
+        position[heap[j]] = j;
+    }
+    void siftUp(int i){
+        while(i > 0 && higher(heap[i], heap[(i - 1) / 2])){
+            swapNodes(i, (i - 1) / 2);
+            i = (i - 1) / 2;
+        }
+    }
+    void siftDown(int i){
+        int size = heap.size();
+        while(true){
+            int best = i;
+            for(int child = 2 * i + 1; child <= 2 * i + 2 && child < size; ++child){
+                if(higher(heap[child], heap[best])){
+                    best = child;
+                }
+            }
+            if(best == i){
+                return;
+            }
+            swapNodes(i, best);
+            i = best;
+        }
+    }
+};
+
+/**
+ * Decides which ready reservation stations fire and which completed function units get the result
+ * buses. The scheduling queue reports entries as they are dispatched, become ready and are deleted,
+ * so each policy keeps its own ready structure up to date instead of rescanning the queue.
+ */
+class SchedulerPolicy {
+    protected:
+    vector<uint64_t> slot_tag;
+
+    public:
+    SchedulerPolicy(int slots) : slot_tag(slots, 0){
+    }
+    virtual ~SchedulerPolicy(){
+    }
+
+    virtual void dispatched(int slot, const reservation_station& entry){
+        slot_tag[slot] = entry.dest_reg_tag;
+    }
+    virtual void deleted(int slot){
+    }
+    virtual void ready(int slot, int fu_type) = 0;
+    virtual int selectToFire(int fu_type) = 0;
+    virtual function_unit* selectBroadcast(vector<function_unit>* completed_units);
+};
+
+/**
+ * Fires the oldest ready instruction for each function unit; broadcasts the unit stalled longest,
+ * then the oldest. This is the simulator's original behavior.
+ */
+class OldestFirstPolicy : public SchedulerPolicy {
+    struct older{
+        const vector<uint64_t>* tags;
+        bool operator()(int a, int b) const {
+            return (*tags)[a] < (*tags)[b];
+        }
+    };
+    vector<IndexedHeap<older> > ready_heaps;
+
+    public:
+    OldestFirstPolicy(int slots);
+    void ready(int slot, int fu_type);
+    int selectToFire(int fu_type);
+};
+
+/**
+ * Fires and broadcasts the instruction with the most dependents waiting in the scheduling queue
+ * first, as a cheap stand-in for criticality, breaking ties by age.
+ */
+class CriticalPathPolicy : public SchedulerPolicy {
+    struct more_critical{
+        const vector<uint64_t>* tags;
+        const vector<int>* dependents;
+        bool operator()(int a, int b) const {
+            if((*dependents)[a] != (*dependents)[b]){
+                return (*dependents)[a] > (*dependents)[b];
+            }
+            return (*tags)[a] < (*tags)[b];
+        }
+    };
+    vector<int> dependents;
+    vector<int> slot_type;
+    unordered_map<uint64_t, int> tag_slot;
+    vector<IndexedHeap<more_critical> > ready_heaps;
+
+    public:
+    CriticalPathPolicy(int slots);
+    void dispatched(int slot, const reservation_station& entry);
+    void deleted(int slot);
+    void ready(int slot, int fu_type);
+    int selectToFire(int fu_type);
+    function_unit* selectBroadcast(vector<function_unit>* completed_units);
+
+    private:
+    void addDependent(uint64_t producer_tag);
+};
+
+/**
+ * Fires oldest first, but hands out result buses round-robin across function unit types, so one
+ * type's backlog cannot hold the buses while other types' units sit completed.
+ */
+class RoundRobinPolicy : public OldestFirstPolicy {
+    int next_type;
+
+    public:
+    RoundRobinPolicy(int slots) : OldestFirstPolicy(slots), next_type(0){
+    }
+    function_unit* selectBroadcast(vector<function_unit>* completed_units);
+};
+
+/**
+ * Fires a uniformly random ready instruction per function unit and broadcasts a random completed
+ * unit, from a fixed seed so runs are reproducible.
+ */
+class RandomPolicy : public SchedulerPolicy {
+    vector<vector<int> > ready_slots;
+    mt19937_64 generator;
+
+    public:
+    RandomPolicy(int slots, uint64_t seed);
+    void ready(int slot, int fu_type);
+    int selectToFire(int fu_type);
+    function_unit* selectBroadcast(vector<function_unit>* completed_units);
+};
+
+bool parse_sched_policy(const char* name, sched_policy_t* policy);
+const char* sched_policy_name(sched_policy_t policy);
+SchedulerPolicy* create_scheduler_policy(sched_policy_t policy, int slots, uint64_t seed);
+
+#endif /* SCHEDULER_POLICY_HPP */
@@ -0,0 +1,194 @@
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "self_profile.hpp"
+
+static const char* stage_names[NUM_PROFILE_STAGES] = {
+    "prefetch", "state_update", "execute", "schedule", "dispatch", "fetch"
+};
+
+static const char* counter_names[NUM_PROFILE_COUNTERS] = {
+    "cycles", "instructions", "L1D-miss", "LLC-miss", "br-miss"
+};
+
+static int open_counter(uint32_t type, uint64_t config, int group_fd){
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static uint64_t elapsed_nanoseconds(const timespec& start, const timespec& end){
+    return (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+/**
+ * Opens the counters as one group so they are always scheduled onto the PMU together. A counter the
+ * host does not support is left out; if the group leader cannot be opened only time is measured.
+ */
+SelfProfiler::SelfProfiler(){
+    const uint32_t types[NUM_PROFILE_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+    };
+    const uint64_t configs[NUM_PROFILE_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    memset(calls, 0, sizeof(calls));
+    memset(nanoseconds, 0, sizeof(nanoseconds));
+    memset(counts, 0, sizeof(counts));
+    memset(start_counts, 0, sizeof(start_counts));
+    time_enabled = 0;
+    time_running = 0;
+
+    num_open_counters = 0;
+    int leader = -1;
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+        counter_fds[i] = -1;
+        counter_open[i] = false;
+        if(i > 0 && leader == -1){
+            continue;
+        }
+
+        int fd = open_counter(types[i], configs[i], leader);
+        if(fd >= 0){
+            counter_fds[i] = fd;
+            counter_open[i] = true;
+            ++num_open_counters;
+            if(leader == -1){
+                leader = fd;
+            }
+        }
+    }
+
+    if(leader != -1){
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+SelfProfiler::~SelfProfiler(){
+    for(int i = NUM_PROFILE_COUNTERS - 1; i >= 0; --i){
+        if(counter_open[i]){
+            close(counter_fds[i]);
+        }
+    }
+}
+
+/**
+ * Reads the whole counter group with one syscall, scattering the values into a per-counter array.
+ * If the kernel multiplexed the group with other events, the counts are scaled up by the share of
+ * time it was actually on the PMU. A group that has never been scheduled leaves the values alone.
+ */
+void SelfProfiler::readCounters(uint64_t* values){
+    if(num_open_counters == 0){
+        return;
+    }
+
+    // nr, time_enabled, time_running, then one value per counter in the group
+    uint64_t buffer[3 + NUM_PROFILE_COUNTERS];
+    if(read(counter_fds[COUNTER_CYCLES], buffer, sizeof(buffer)) <= 0){
+        return;
+    }
+
+    time_enabled = buffer[1];
+    time_running = buffer[2];
+    if(time_running == 0){
+        return;
+    }
+
+    double scale = (double) time_enabled / time_running;
+    int next = 3;
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+        if(counter_open[i] && next < 3 + (int) buffer[0]){
+            values[i] = time_running < time_enabled ? (uint64_t) (buffer[next] * scale) : buffer[next];
+            ++next;
+        }
+    }
+}
+
+void SelfProfiler::begin(){
+    readCounters(start_counts);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+void SelfProfiler::end(profile_stage stage){
+    timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    uint64_t end_counts[NUM_PROFILE_COUNTERS];
+    memcpy(end_counts, start_counts, sizeof(end_counts));
+    readCounters(end_counts);
+
+    ++calls[stage];
+    nanoseconds[stage] += elapsed_nanoseconds(start_time, end_time);
+    // Scaled estimates can step backwards when the multiplexing ratio changes between two reads
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+        if(end_counts[i] > start_counts[i]){
+            counts[stage][i] += end_counts[i] - start_counts[i];
+        }
+    }
+}
+
+/**
+ * Prints per-stage totals followed by the same figures per simulated instruction. Counter columns are
+ * left out when the counters could not be opened or were never scheduled onto the PMU.
+ */
+void SelfProfiler::report(FILE* out, uint64_t simulated_instructions){
+    double per_inst = simulated_instructions ? 1.0 / simulated_instructions : 0;
+    bool show_counters = countersAvailable();
+
+    const char* source = "timer only, counters unavailable";
+    if(show_counters){
+        source = time_running < time_enabled ? "hardware counters, scaled for multiplexing" : "hardware counters";
+    }
+    fprintf(out, "Self profile (%s):\n", source);
+    fprintf(out, "%-14s%12s%14s", "stage", "calls", "time(ms)");
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+        if(show_counters && counter_open[i]){
+            fprintf(out, "%16s", counter_names[i]);
+        }
+    }
+    fprintf(out, "\n");
+
+    for(int stage = 0; stage < NUM_PROFILE_STAGES; ++stage){
+        fprintf(out, "%-14s%12lu%14.3f", stage_names[stage], (unsigned long) calls[stage], nanoseconds[stage] / 1e6);
+        for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+            if(show_counters && counter_open[i]){
+                fprintf(out, "%16lu", (unsigned long) counts[stage][i]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "Per simulated instruction (%lu instructions):\n", (unsigned long) simulated_instructions);
+    fprintf(out, "%-14s%12s%14s", "stage", "", "time(ns)");
+    for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+        if(show_counters && counter_open[i]){
+            fprintf(out, "%16s", counter_names[i]);
+        }
+    }
+    fprintf(out, "\n");
+
+    for(int stage = 0; stage < NUM_PROFILE_STAGES; ++stage){
+        fprintf(out, "%-14s%12s%14.2f", stage_names[stage], "", nanoseconds[stage] * per_inst);
+        for(int i = 0; i < NUM_PROFILE_COUNTERS; ++i){
+            if(show_counters && counter_open[i]){
+                fprintf(out, "%16.2f", counts[stage][i] * per_inst);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
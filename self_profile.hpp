@@ -0,0 +1,61 @@
+#ifndef SELF_PROFILE_HPP
+#define SELF_PROFILE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+typedef enum {
+    STAGE_START_PREFETCH,
+    STAGE_STATE_UPDATE,
+    STAGE_EXECUTE,
+    STAGE_SCHEDULE,
+    STAGE_DISPATCH,
+    STAGE_FETCH,
+    NUM_PROFILE_STAGES
+} profile_stage;
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    NUM_PROFILE_COUNTERS
+} profile_counter;
+
+/**
+ * Measures the host cost of each simulator stage with hardware performance counters, falling back
+ * to wall-clock time alone when perf_event_open() is not permitted or not supported, or when the
+ * counters never get onto the PMU.
+ */
+class SelfProfiler {
+    int counter_fds[NUM_PROFILE_COUNTERS];
+    bool counter_open[NUM_PROFILE_COUNTERS];
+    int num_open_counters;
+    uint64_t time_enabled;
+    uint64_t time_running;
+
+    uint64_t calls[NUM_PROFILE_STAGES];
+    uint64_t nanoseconds[NUM_PROFILE_STAGES];
+    uint64_t counts[NUM_PROFILE_STAGES][NUM_PROFILE_COUNTERS];
+
+    timespec start_time;
+    uint64_t start_counts[NUM_PROFILE_COUNTERS];
+
+    public:
+    SelfProfiler();
+    ~SelfProfiler();
+
+    bool countersAvailable(){
+        return num_open_counters > 0 && time_running > 0;
+    }
+    void begin();
+    void end(profile_stage stage);
+    void report(FILE* out, uint64_t simulated_instructions);
+
+    private:
+    void readCounters(uint64_t* values);
+};
+
+#endif /* SELF_PROFILE_HPP */
@@ -0,0 +1,326 @@
+#include <climits>
+#include <cstring>
+#include <thread>
+#include "trace_analysis.hpp"
+
+// Below this many instructions per thread the analysis is cheaper to run serially
+#define MIN_ANALYSIS_CHUNK (1 << 20)
+
+// Building a transfer function costs a few times the serial walk per instruction, so splitting only
+// pays off with at least this many threads
+#define MIN_ANALYSIS_THREADS 4
+
+// Transfer rows are stored as whole blocks of this many path lengths, updated with vector operations
+#define PATH_BLOCK 4
+
+typedef int32_t path_block __attribute__((vector_size(PATH_BLOCK * sizeof(int32_t))));
+
+// Path length meaning "does not depend on this live-in"; stays hugely negative after any chunk's increments
+#define NO_PATH (INT_MIN / 2)
+
+static const char* fu_limiter_names[NUM_FU_TYPES] = {"k0 FUs", "k1 FUs", "k2 FUs"};
+
+/**
+ * Summary of a chunk's effect on the register ready levels, as max-plus functions of the levels
+ * live into the chunk. Row r of paths holds, for each live-in register, the longest path from it to
+ * the final writer of r (NO_PATH if none), followed by the longest path that starts inside the chunk.
+ */
+typedef struct chunk_transfer{
+    vector<int> live_in;
+    vector<bool> written;
+    size_t row_blocks;
+    vector<path_block> paths;
+} chunk_transfer;
+
+/**
+ * Per-thread level widths: how many instructions, and how many of each FU type, sit on each level.
+ */
+typedef struct level_widths{
+    vector<uint32_t> total;
+    vector<uint32_t> type[NUM_FU_TYPES];
+} level_widths;
+
+static inline bool valid_register(int32_t reg){
+    return reg >= 0 && reg < NUM_REGISTERS;
+}
+
+/**
+ * Runs work(i) for each of chunks pieces on its own thread.
+ */
+template<typename Work>
+static void run_chunks(unsigned chunks, Work work){
+    if(chunks == 1){
+        work(0);
+        return;
+    }
+
+    vector<thread> workers;
+    for(unsigned i = 0; i < chunks; ++i){
+        workers.push_back(thread(work, i));
+    }
+    for(auto& worker : workers){
+        worker.join();
+    }
+}
+
+/**
+ * Builds the transfer function of the instructions in [begin, end), using the same source/destination
+ * rules as initReservationStation(): sources are read before the destination is claimed and -1 means
+ * no register. Work per instruction is proportional to the number of live-in registers.
+ */
+static void compute_transfer(const proc_inst_t* begin, const proc_inst_t* end, chunk_transfer* transfer){
+    vector<int> live_in_index(NUM_REGISTERS, -1);
+    vector<bool> written(NUM_REGISTERS, false);
+    for(const proc_inst_t* inst = begin; inst != end; ++inst){
+        for(int i = 0; i < 2; ++i){
+            int32_t src = inst->src_reg[i];
+            if(valid_register(src) && !written[src] && live_in_index[src] == -1){
+                live_in_index[src] = transfer->live_in.size();
+                transfer->live_in.push_back(src);
+            }
+        }
+        if(valid_register(inst->dest_reg)){
+            written[inst->dest_reg] = true;
+        }
+    }
+
+    size_t live_ins = transfer->live_in.size();
+    size_t blocks = live_ins / PATH_BLOCK + 1;
+    path_block no_path_block;
+    for(int j = 0; j < PATH_BLOCK; ++j){
+        no_path_block[j] = NO_PATH;
+    }
+
+    transfer->written = written;
+    transfer->row_blocks = blocks;
+    transfer->paths.assign(NUM_REGISTERS * blocks, no_path_block);
+    for(size_t i = 0; i < live_ins; ++i){
+        transfer->paths[transfer->live_in[i] * blocks + i / PATH_BLOCK][i % PATH_BLOCK] = 0;
+    }
+
+    vector<path_block> start(blocks, no_path_block);
+    start[live_ins / PATH_BLOCK][live_ins % PATH_BLOCK] = 0;
+    vector<path_block> level(blocks);
+    for(const proc_inst_t* inst = begin; inst != end; ++inst){
+        copy(start.begin(), start.end(), level.begin());
+        for(int i = 0; i < 2; ++i){
+            int32_t src = inst->src_reg[i];
+            if(valid_register(src)){
+                const path_block* row = &transfer->paths[src * blocks];
+                for(size_t block = 0; block < blocks; ++block){
+                    level[block] = level[block] > row[block] ? level[block] : row[block];
+                }
+            }
+        }
+
+        if(valid_register(inst->dest_reg)){
+            path_block* row = &transfer->paths[inst->dest_reg * blocks];
+            for(size_t block = 0; block < blocks; ++block){
+                row[block] = level[block] + 1;
+            }
+        }
+    }
+}
+
+/**
+ * Applies a chunk's transfer function to the ready levels live into it, giving the levels live out.
+ */
+static void apply_transfer(const chunk_transfer& transfer, const vector<uint64_t>& in, vector<uint64_t>* out){
+    size_t live_ins = transfer.live_in.size();
+    for(int reg = 0; reg < NUM_REGISTERS; ++reg){
+        if(!transfer.written[reg]){
+            (*out)[reg] = in[reg];
+            continue;
+        }
+
+        const path_block* row = &transfer.paths[reg * transfer.row_blocks];
+        int64_t level = row[live_ins / PATH_BLOCK][live_ins % PATH_BLOCK];
+        for(size_t i = 0; i < live_ins; ++i){
+            int32_t path = row[i / PATH_BLOCK][i % PATH_BLOCK];
+            if(path >= 0){
+                level = max(level, (int64_t) (in[transfer.live_in[i]] + path));
+            }
+        }
+        (*out)[reg] = level;
+    }
+}
+
+/**
+ * Walks [begin, end) from known live-in ready levels, recording how many instructions land on each level.
+ */
+static void count_levels(const proc_inst_t* begin, const proc_inst_t* end, vector<uint64_t> ready, level_widths* widths){
+    for(const proc_inst_t* inst = begin; inst != end; ++inst){
+        uint64_t level = 0;
+        for(int i = 0; i < 2; ++i){
+            if(valid_register(inst->src_reg[i])){
+                level = max(level, ready[inst->src_reg[i]]);
+            }
+        }
+        ++level;
+
+        if(valid_register(inst->dest_reg)){
+            ready[inst->dest_reg] = level;
+        }
+
+        if(level >= widths->total.size()){
+            size_t size = max((size_t) level + 1, widths->total.size() * 2);
+            widths->total.resize(size);
+            for(int t = 0; t < NUM_FU_TYPES; ++t){
+                widths->type[t].resize(size);
+            }
+        }
+        ++widths->total[level];
+        if(inst->op_code >= 0 && inst->op_code < NUM_FU_TYPES){
+            ++widths->type[inst->op_code][level];
+        }
+    }
+}
+
+/**
+ * Tightens the cycle bound if work units spread over the given per-cycle capacity need more cycles.
+ */
+static void apply_bound(uint64_t work, uint64_t capacity, const char* limiter, trace_analysis_t* p_analysis){
+    if(work == 0 || p_analysis->bound_cycles == 0){
+        return;
+    }
+    if(capacity == 0){
+        p_analysis->bound_cycles = 0;
+        p_analysis->bound_limiter = limiter;
+        return;
+    }
+
+    uint64_t cycles = (work + capacity - 1) / capacity;
+    if(cycles > p_analysis->bound_cycles){
+        p_analysis->bound_cycles = cycles;
+        p_analysis->bound_limiter = limiter;
+    }
+}
+
+/**
+ * Computes the unlimited-resource critical path, ILP histogram and per-type parallelism of a trace,
+ * plus an IPC bound for the given machine.
+ *
+ * Dependences are serial, so the trace is split into chunks processed in three phases: each chunk's
+ * transfer function is built in parallel, the functions are composed in order to find every chunk's
+ * live-in levels, and then each chunk is walked in parallel from its live-ins to count levels.
+ */
+void analyze_trace(const vector<proc_inst_t>& instructions, uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2,
+                   uint64_t f, unsigned threads, trace_analysis_t* p_analysis){
+    size_t n = instructions.size();
+    const proc_inst_t* data = instructions.data();
+    unsigned chunks = 1;
+    if(threads >= MIN_ANALYSIS_THREADS){
+        chunks = max(1u, min(threads, (unsigned) (n / MIN_ANALYSIS_CHUNK)));
+    }
+    vector<const proc_inst_t*> bounds(chunks + 1);
+    for(unsigned i = 0; i <= chunks; ++i){
+        bounds[i] = data + n / chunks * i;
+    }
+    bounds[chunks] = data + n;
+
+    vector<chunk_transfer> transfers(chunks);
+    run_chunks(chunks - 1, [&](unsigned i){
+        compute_transfer(bounds[i], bounds[i + 1], &transfers[i]);
+    });
+
+    vector<vector<uint64_t> > live_in(chunks, vector<uint64_t>(NUM_REGISTERS, 0));
+    for(unsigned i = 1; i < chunks; ++i){
+        apply_transfer(transfers[i - 1], live_in[i - 1], &live_in[i]);
+    }
+
+    vector<level_widths> widths(chunks);
+    run_chunks(chunks, [&](unsigned i){
+        count_levels(bounds[i], bounds[i + 1], live_in[i], &widths[i]);
+    });
+
+    level_widths merged;
+    for(auto& chunk_widths : widths){
+        if(chunk_widths.total.size() > merged.total.size()){
+            merged.total.resize(chunk_widths.total.size());
+            for(int t = 0; t < NUM_FU_TYPES; ++t){
+                merged.type[t].resize(chunk_widths.total.size());
+            }
+        }
+        for(size_t level = 0; level < chunk_widths.total.size(); ++level){
+            merged.total[level] += chunk_widths.total[level];
+            for(int t = 0; t < NUM_FU_TYPES; ++t){
+                merged.type[t][level] += chunk_widths.type[t][level];
+            }
+        }
+    }
+
+    memset(p_analysis, 0, sizeof(trace_analysis_t));
+    p_analysis->instructions = n;
+    for(size_t level = 1; level < merged.total.size(); ++level){
+        uint32_t width = merged.total[level];
+        if(width == 0){
+            continue;
+        }
+
+        p_analysis->critical_path = level;
+        int bucket = 0;
+        while(bucket < NUM_ILP_BUCKETS - 1 && (width >> (bucket + 1)) != 0){
+            ++bucket;
+        }
+        ++p_analysis->ilp_levels[bucket];
+        p_analysis->ilp_instructions[bucket] += width;
+
+        for(int t = 0; t < NUM_FU_TYPES; ++t){
+            p_analysis->type_instructions[t] += merged.type[t][level];
+            p_analysis->type_peak_width[t] = max(p_analysis->type_peak_width[t], (uint64_t) merged.type[t][level]);
+        }
+    }
+    p_analysis->ilp = p_analysis->critical_path ? (double) n / p_analysis->critical_path : 0;
+
+    p_analysis->bound_cycles = p_analysis->critical_path;
+    p_analysis->bound_limiter = "dataflow";
+    apply_bound(n, f, "fetch width", p_analysis);
+    apply_bound(n, r, "result buses", p_analysis);
+    uint64_t fu_counts[NUM_FU_TYPES] = {k0, k1, k2};
+    for(int t = 0; t < NUM_FU_TYPES; ++t){
+        apply_bound(p_analysis->type_instructions[t], fu_counts[t], fu_limiter_names[t], p_analysis);
+    }
+    p_analysis->ipc_bound = p_analysis->bound_cycles ? (double) n / p_analysis->bound_cycles : 0;
+}
+
+void print_analysis(FILE* out, const trace_analysis_t* p_analysis){
+    fprintf(out, "Trace analysis:\n");
+    fprintf(out, "Total instructions: %lu\n", (unsigned long) p_analysis->instructions);
+    fprintf(out, "Critical path (levels): %lu\n", (unsigned long) p_analysis->critical_path);
+    fprintf(out, "Dataflow ILP: %f\n", p_analysis->ilp);
+
+    fprintf(out, "ILP histogram (level width: levels, instructions):\n");
+    for(int bucket = 0; bucket < NUM_ILP_BUCKETS; ++bucket){
+        if(p_analysis->ilp_levels[bucket] == 0){
+            continue;
+        }
+        uint64_t low = 1ULL << bucket;
+        if(bucket == NUM_ILP_BUCKETS - 1){
+            fprintf(out, "  %lu+", (unsigned long) low);
+        }
+        else if(low == 1){
+            fprintf(out, "  1");
+        }
+        else{
+            fprintf(out, "  %lu-%lu", (unsigned long) low, (unsigned long) (2 * low - 1));
+        }
+        fprintf(out, ": %lu, %lu\n", (unsigned long) p_analysis->ilp_levels[bucket],
+                (unsigned long) p_analysis->ilp_instructions[bucket]);
+    }
+
+    fprintf(out, "FU type parallelism (instructions, avg per level, peak per level):\n");
+    for(int t = 0; t < NUM_FU_TYPES; ++t){
+        double average = p_analysis->critical_path ? (double) p_analysis->type_instructions[t] / p_analysis->critical_path : 0;
+        fprintf(out, "  k%d: %lu, %f, %lu\n", t, (unsigned long) p_analysis->type_instructions[t], average,
+                (unsigned long) p_analysis->type_peak_width[t]);
+    }
+
+    if(p_analysis->bound_cycles == 0 && p_analysis->instructions != 0){
+        fprintf(out, "Resource bound (cycles): none, trace cannot complete without %s\n", p_analysis->bound_limiter);
+    }
+    else{
+        fprintf(out, "Resource bound (cycles): %lu, limited by %s\n", (unsigned long) p_analysis->bound_cycles,
+                p_analysis->bound_limiter);
+    }
+    fprintf(out, "IPC upper bound: %f\n", p_analysis->ipc_bound);
+}
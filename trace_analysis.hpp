@@ -0,0 +1,38 @@
+#ifndef TRACE_ANALYSIS_HPP
+#define TRACE_ANALYSIS_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "procsim.hpp"
+
+#define NUM_ILP_BUCKETS 16
+
+/**
+ * Dataflow limits of a trace. A level is one step along the register dependence chains, so an
+ * instruction's level is one more than the deepest level among the producers of its sources.
+ */
+typedef struct _trace_analysis_t
+{
+    uint64_t instructions;
+    uint64_t critical_path;
+    double ilp;
+
+    // ilp_levels[b] and ilp_instructions[b] count the levels of width [2^b, 2^(b+1)) and the
+    // instructions they hold
+    uint64_t ilp_levels[NUM_ILP_BUCKETS];
+    uint64_t ilp_instructions[NUM_ILP_BUCKETS];
+
+    uint64_t type_instructions[NUM_FU_TYPES];
+    uint64_t type_peak_width[NUM_FU_TYPES];
+
+    uint64_t bound_cycles;
+    double ipc_bound;
+    const char* bound_limiter;
+} trace_analysis_t;
+
+void analyze_trace(const vector<proc_inst_t>& instructions, uint64_t r, uint64_t k0, uint64_t k1, uint64_t k2,
+                   uint64_t f, unsigned threads, trace_analysis_t* p_analysis);
+void print_analysis(FILE* out, const trace_analysis_t* p_analysis);
+
+#endif /* TRACE_ANALYSIS_HPP */
@@ -0,0 +1,319 @@
+#include <cstring>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "trace_parser.hpp"
+
+// Amount of trace text TraceReader parses per block
+#define READ_BLOCK (256 << 10)
+
+// Below this much text per thread the cost of starting threads outweighs the parse itself
+#define MIN_PARSE_CHUNK (4 << 20)
+
+/**
+ * Character class tables used by the scanner so every character costs one load and one compare.
+ */
+static struct scan_tables{
+    unsigned char hex_value[256];
+    bool space[256];
+
+    scan_tables(){
+        memset(hex_value, 0xff, sizeof(hex_value));
+        memset(space, 0, sizeof(space));
+        for(int c = '0'; c <= '9'; ++c){
+            hex_value[c] = c - '0';
+        }
+        for(int c = 'a'; c <= 'f'; ++c){
+            hex_value[c] = c - 'a' + 10;
+            hex_value[c - 'a' + 'A'] = c - 'a' + 10;
+        }
+        space[(unsigned char) ' '] = true;
+        space[(unsigned char) '\t'] = true;
+        space[(unsigned char) '\n'] = true;
+        space[(unsigned char) '\v'] = true;
+        space[(unsigned char) '\f'] = true;
+        space[(unsigned char) '\r'] = true;
+    }
+} tables;
+
+static inline const char* skip_space(const char* p, const char* end){
+    while(p != end && tables.space[(unsigned char) *p]){
+        ++p;
+    }
+    return p;
+}
+
+static inline const char* skip_sign(const char* p, const char* end, bool* negative){
+    *negative = false;
+    if(p != end && (*p == '-' || *p == '+')){
+        *negative = (*p == '-');
+        ++p;
+    }
+    return p;
+}
+
+/**
+ * Parses a field the way fscanf's %x does: optional sign, optional 0x prefix, at least one hex digit.
+ * Returns NULL if there is no number at p.
+ */
+static inline const char* parse_hex(const char* p, const char* end, uint32_t* value){
+    bool negative;
+    p = skip_sign(p, end, &negative);
+    if(end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') && tables.hex_value[(unsigned char) p[2]] < 16){
+        p += 2;
+    }
+
+    const char* digits = p;
+    uint32_t result = 0;
+    unsigned char digit;
+    while(p != end && (digit = tables.hex_value[(unsigned char) *p]) < 16){
+        result = (result << 4) | digit;
+        ++p;
+    }
+    if(p == digits){
+        return NULL;
+    }
+
+    *value = negative ? 0u - result : result;
+    return p;
+}
+
+/**
+ * Parses a field the way fscanf's %d does: optional sign followed by at least one decimal digit.
+ * Returns NULL if there is no number at p.
+ */
+static inline const char* parse_dec(const char* p, const char* end, int32_t* value){
+    bool negative;
+    p = skip_sign(p, end, &negative);
+
+    const char* digits = p;
+    uint32_t result = 0;
+    unsigned digit;
+    while(p != end && (digit = (unsigned char) *p - '0') < 10){
+        result = result * 10 + digit;
+        ++p;
+    }
+    if(p == digits){
+        return NULL;
+    }
+
+    *value = (int32_t) (negative ? 0u - result : result);
+    return p;
+}
+
+/**
+ * Parses "address op_code dest src1 src2" records from [begin, end) and appends them to instructions,
+ * remapping op_code -1 to 1. Returns end if the whole range parsed, otherwise the start of the first
+ * malformed record, which is where fscanf() would have stopped the trace.
+ */
+const char* parse_trace_chunk(const char* begin, const char* end, vector<proc_inst_t>* instructions){
+    const char* p = begin;
+    proc_inst_t inst = proc_inst_t();
+
+    while(true){
+        const char* record = p;
+        p = skip_space(p, end);
+        if(p == end){
+            return end;
+        }
+
+        if(!(p = parse_hex(p, end, &inst.instruction_address))
+                || !(p = parse_dec(skip_space(p, end), end, &inst.op_code))
+                || !(p = parse_dec(skip_space(p, end), end, &inst.dest_reg))
+                || !(p = parse_dec(skip_space(p, end), end, &inst.src_reg[0]))
+                || !(p = parse_dec(skip_space(p, end), end, &inst.src_reg[1]))){
+            return record;
+        }
+
+        if(inst.op_code == -1){
+            inst.op_code = 1;
+        }
+        instructions->push_back(inst);
+    }
+}
+
+/**
+ * Parses a whole trace. Large traces are split at newline boundaries and the pieces parsed on separate
+ * threads, then concatenated in order up to the first malformed record.
+ */
+void parse_trace(const char* data, size_t size, vector<proc_inst_t>* instructions, unsigned threads){
+    const char* end = data + size;
+    unsigned chunks = threads;
+    if(chunks > size / MIN_PARSE_CHUNK){
+        chunks = size / MIN_PARSE_CHUNK;
+    }
+
+    if(chunks <= 1){
+        instructions->reserve(instructions->size() + size / 16);
+        parse_trace_chunk(data, end, instructions);
+        return;
+    }
+
+    vector<const char*> bounds(chunks + 1);
+    bounds[0] = data;
+    bounds[chunks] = end;
+    for(unsigned i = 1; i < chunks; ++i){
+        const char* split = data + size / chunks * i;
+        if(split < bounds[i - 1]){
+            split = bounds[i - 1];
+        }
+        const char* newline = (const char*) memchr(split, '\n', end - split);
+        bounds[i] = newline ? newline + 1 : end;
+    }
+
+    vector<vector<proc_inst_t> > parsed(chunks);
+    vector<const char*> stops(chunks);
+    vector<thread> workers;
+    for(unsigned i = 0; i < chunks; ++i){
+        workers.push_back(thread([&, i](){
+            parsed[i].reserve((bounds[i + 1] - bounds[i]) / 16);
+            stops[i] = parse_trace_chunk(bounds[i], bounds[i + 1], &parsed[i]);
+        }));
+    }
+    for(auto& worker : workers){
+        worker.join();
+    }
+
+    size_t total = 0;
+    for(unsigned i = 0; i < chunks; ++i){
+        total += parsed[i].size();
+    }
+    instructions->reserve(instructions->size() + total);
+    for(unsigned i = 0; i < chunks; ++i){
+        instructions->insert(instructions->end(), parsed[i].begin(), parsed[i].end());
+        if(stops[i] != bounds[i + 1]){
+            break;
+        }
+    }
+}
+
+unsigned default_parse_threads(){
+    unsigned threads = thread::hardware_concurrency();
+    return threads ? threads : 1;
+}
+
+/**
+ * Maps the rest of file if it is a non-empty regular file. The pages are only read as they are touched.
+ */
+bool TraceBuffer::map(FILE* file){
+    release();
+
+    int fd = fileno(file);
+    struct stat st;
+    off_t offset = ftello(file);
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || offset < 0 || st.st_size <= offset){
+        return false;
+    }
+
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapped == MAP_FAILED){
+        return false;
+    }
+
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    loaded = true;
+    mapping = mapped;
+    mapping_size = st.st_size;
+    trace_data = (const char*) mapped + offset;
+    trace_size = st.st_size - offset;
+    return true;
+}
+
+/**
+ * Makes the rest of file available in memory, mapping it when it is a regular file.
+ */
+bool TraceBuffer::load(FILE* file){
+    if(map(file)){
+        return true;
+    }
+
+    char block[1 << 16];
+    size_t n;
+    while((n = fread(block, 1, sizeof(block), file)) > 0){
+        contents.insert(contents.end(), block, block + n);
+    }
+    loaded = true;
+    trace_data = contents.data();
+    trace_size = contents.size();
+    return !ferror(file);
+}
+
+void TraceBuffer::release(){
+    if(mapping != NULL){
+        munmap(mapping, mapping_size);
+    }
+    loaded = false;
+    mapping = NULL;
+    mapping_size = 0;
+    contents.clear();
+    trace_data = NULL;
+    trace_size = 0;
+}
+
+/**
+ * Replaces instructions with the next block of the trace. Returns false once the trace is exhausted
+ * or a malformed record has been reached.
+ */
+bool TraceReader::next(vector<proc_inst_t>* instructions){
+    instructions->clear();
+    while(!finished && instructions->empty()){
+        if(buffer != NULL && buffer->isLoaded()){
+            finished = !nextFromBuffer(instructions);
+        }
+        else{
+            finished = !nextFromFile(instructions);
+        }
+    }
+
+    return !instructions->empty();
+}
+
+/**
+ * Parses the next READ_BLOCK of the buffer, extended to the end of its last line.
+ */
+bool TraceReader::nextFromBuffer(vector<proc_inst_t>* instructions){
+    const char* begin = buffer->data() + position;
+    const char* end = buffer->data() + buffer->size();
+    if(begin == end){
+        return false;
+    }
+
+    const char* block_end = end;
+    if((size_t) (end - begin) > READ_BLOCK){
+        const char* newline = (const char*) memchr(begin + READ_BLOCK, '\n', end - begin - READ_BLOCK);
+        block_end = newline ? newline + 1 : end;
+    }
+
+    position = block_end - buffer->data();
+    return parse_trace_chunk(begin, block_end, instructions) == block_end;
+}
+
+/**
+ * Reads the next READ_BLOCK from the file and parses the complete lines in it, keeping any partial
+ * last line for the next call.
+ */
+bool TraceReader::nextFromFile(vector<proc_inst_t>* instructions){
+    size_t carried = pending.size();
+    pending.resize(carried + READ_BLOCK);
+    size_t n = fread(pending.data() + carried, 1, READ_BLOCK, file);
+    pending.resize(carried + n);
+
+    const char* begin = pending.data();
+    const char* end = begin + pending.size();
+    if(n == 0){
+        parse_trace_chunk(begin, end, instructions);
+        pending.clear();
+        return false;
+    }
+
+    const char* newline = (const char*) memrchr(begin, '\n', end - begin);
+    if(newline == NULL){
+        return true;
+    }
+
+    const char* block_end = newline + 1;
+    bool complete = parse_trace_chunk(begin, block_end, instructions) == block_end;
+    pending.erase(pending.begin(), pending.begin() + (block_end - begin));
+    return complete;
+}
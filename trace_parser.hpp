@@ -0,0 +1,77 @@
+#ifndef TRACE_PARSER_HPP
+#define TRACE_PARSER_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "procsim.hpp"
+
+/**
+ * The raw text of a trace. Regular files are memory mapped, anything else (pipes, terminals) is
+ * bulk-read into memory.
+ */
+class TraceBuffer {
+    bool loaded;
+    const char* trace_data;
+    size_t trace_size;
+    void* mapping;
+    size_t mapping_size;
+    vector<char> contents;
+
+    public:
+    TraceBuffer(){
+        loaded = false;
+        trace_data = NULL;
+        trace_size = 0;
+        mapping = NULL;
+        mapping_size = 0;
+    }
+    ~TraceBuffer(){
+        release();
+    }
+
+    bool load(FILE* file);
+    bool map(FILE* file);
+    void release();
+    bool isLoaded() const {
+        return loaded;
+    }
+    const char* data() const {
+        return trace_data;
+    }
+    size_t size() const {
+        return trace_size;
+    }
+};
+
+/**
+ * Parses a trace a block at a time, either from a loaded TraceBuffer or streamed straight from a file,
+ * so instructions become available before the whole trace has been read.
+ */
+class TraceReader {
+    const TraceBuffer* buffer;
+    FILE* file;
+    size_t position;
+    vector<char> pending;
+    bool finished;
+
+    public:
+    TraceReader(const TraceBuffer* buffer, FILE* file){
+        this->buffer = buffer;
+        this->file = file;
+        position = 0;
+        finished = false;
+    }
+
+    bool next(vector<proc_inst_t>* instructions);
+
+    private:
+    bool nextFromBuffer(vector<proc_inst_t>* instructions);
+    bool nextFromFile(vector<proc_inst_t>* instructions);
+};
+
+const char* parse_trace_chunk(const char* begin, const char* end, vector<proc_inst_t>* instructions);
+void parse_trace(const char* data, size_t size, vector<proc_inst_t>* instructions, unsigned threads);
+unsigned default_parse_threads();
+
+#endif /* TRACE_PARSER_HPP */
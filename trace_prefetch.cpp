@@ -0,0 +1,74 @@
+#include "trace_prefetch.hpp"
+
+/**
+ * Waits out a full or empty ring: spin briefly, since the other side is normally running on another
+ * core, then give the core up so a single-core host still makes progress.
+ */
+static inline void backoff(int* spins){
+    if(++*spins > RING_SPINS){
+        this_thread::yield();
+    }
+}
+
+void TracePrefetcher::start(){
+    producer = thread(&TracePrefetcher::produce, this);
+}
+
+/**
+ * Stops the producer early, for when the simulator will not consume the rest of the trace.
+ */
+void TracePrefetcher::stop(){
+    stopping.store(true, memory_order_relaxed);
+    if(producer.joinable()){
+        producer.join();
+    }
+}
+
+/**
+ * Producer thread: decodes the trace a block at a time via read_trace_block() and pushes the
+ * instructions into the ring, tagged in trace order.
+ */
+void TracePrefetcher::produce(){
+    vector<proc_inst_t> block;
+    uint64_t count = 0;
+
+    while(read_trace_block(&block)){
+        for(auto& inst : block){
+            ++count;
+            inst.tag = count;
+            inst.inst_number = count;
+
+            int spins = 0;
+            while(!ring.tryPush(inst)){
+                if(stopping.load(memory_order_relaxed)){
+                    return;
+                }
+                backoff(&spins);
+            }
+        }
+    }
+
+    finished.store(true, memory_order_release);
+}
+
+/**
+ * True if there is another instruction in the trace, waiting for the producer if it has not decided yet.
+ */
+bool TracePrefetcher::hasNext(){
+    int spins = 0;
+    while(!ring.ready()){
+        if(finished.load(memory_order_acquire)){
+            return ring.ready();
+        }
+        backoff(&spins);
+    }
+
+    return true;
+}
+
+/**
+ * Takes the next instruction of the trace. Returns false once the trace is exhausted.
+ */
+bool TracePrefetcher::next(proc_inst_t* inst){
+    return hasNext() && ring.tryPop(inst);
+}
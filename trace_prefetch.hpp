@@ -0,0 +1,112 @@
+#ifndef TRACE_PREFETCH_HPP
+#define TRACE_PREFETCH_HPP
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "procsim.hpp"
+
+// Keeps the producer's and consumer's indices on separate cache lines
+#define CACHE_LINE_SIZE 64
+
+// Spins this many times on an empty or full ring before yielding the core
+#define RING_SPINS 64
+
+/**
+ * Bounded lock-free ring for exactly one producer thread and one consumer thread. Each side only
+ * writes its own index and keeps a cached copy of the other side's, so the shared indices are only
+ * re-read when the ring looks full or empty.
+ */
+template<typename T>
+class SpscRing {
+    vector<T> slots;
+    size_t mask;
+
+    char head_padding[CACHE_LINE_SIZE];
+    atomic<size_t> head;
+    size_t cached_tail;
+
+    char tail_padding[CACHE_LINE_SIZE];
+    atomic<size_t> tail;
+    size_t cached_head;
+    char end_padding[CACHE_LINE_SIZE];
+
+    public:
+    // capacity must be a power of two
+    SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), cached_tail(0), tail(0), cached_head(0){
+    }
+
+    /**
+     * Producer side. Returns false if the ring is full.
+     */
+    bool tryPush(const T& value){
+        size_t t = tail.load(memory_order_relaxed);
+        if(t - cached_head == slots.size()){
+            cached_head = head.load(memory_order_acquire);
+            if(t - cached_head == slots.size()){
+                return false;
+            }
+        }
+
+        slots[t & mask] = value;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Returns false if the ring is empty.
+     */
+    bool tryPop(T* value){
+        size_t h = head.load(memory_order_relaxed);
+        if(h == cached_tail){
+            cached_tail = tail.load(memory_order_acquire);
+            if(h == cached_tail){
+                return false;
+            }
+        }
+
+        *value = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. True if a value is ready to pop.
+     */
+    bool ready(){
+        size_t h = head.load(memory_order_relaxed);
+        if(h == cached_tail){
+            cached_tail = tail.load(memory_order_acquire);
+        }
+        return h != cached_tail;
+    }
+};
+
+/**
+ * Decodes the trace on a background thread, numbering instructions in trace order and handing them
+ * to fetch() through an SpscRing. The producer waits while the ring is full, and the simulator only
+ * waits when it has caught up with the producer.
+ */
+class TracePrefetcher {
+    SpscRing<proc_inst_t> ring;
+    atomic<bool> finished;
+    atomic<bool> stopping;
+    thread producer;
+
+    public:
+    TracePrefetcher(size_t capacity) : ring(capacity), finished(false), stopping(false){
+    }
+    ~TracePrefetcher(){
+        stop();
+    }
+
+    void start();
+    void stop();
+    bool hasNext();
+    bool next(proc_inst_t* inst);
+
+    private:
+    void produce();
+};
+
+#endif /* TRACE_PREFETCH_HPP */